@@ -0,0 +1,479 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+/*
+#include <cudd.h>
+#include <cudd/util.h>
+#include <cudd/st.h>
+*/
+#include "build_bdd.h"
+
+/* Pipelined compilation of stable models into a BDD.
+
+The caller hands models to BddBuilder_Add, which only copies them into
+a block. Full blocks go to a pool of producer threads that turn each one
+into a trie of its distinct models, and a single consumer thread, the
+only one touching the DdManager, converts the tries into BDDs and ORs
+them into the accumulator. Parsing and deduplication thus overlap with
+the CUDD apply operations. */
+
+static bool
+queueInit(BuildQueue *q, int capacity)
+{
+    q->items = ALLOC(void *, capacity);
+    if (q->items == NULL)
+        return false;
+    q->capacity = capacity;
+    q->head = 0;
+    q->size = 0;
+    q->closed = false;
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+    return true;
+}
+
+static void
+queueDestroy(BuildQueue *q)
+{
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+    FREE(q->items);
+}
+
+/* Appends <code> item </code>, waiting while the queue is full so that a
+slow stage bounds the memory held by the faster ones. */
+static void
+queuePush(BuildQueue *q, void *item)
+{
+    pthread_mutex_lock(&q->mutex);
+    while (q->size == q->capacity)
+        pthread_cond_wait(&q->not_full, &q->mutex);
+    q->items[(q->head + q->size) % q->capacity] = item;
+    q->size++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+/* Removes the oldest item, waiting while the queue is empty. Returns NULL
+once the queue is closed and drained. */
+static void *
+queuePop(BuildQueue *q)
+{
+    void *item = NULL;
+
+    pthread_mutex_lock(&q->mutex);
+    while ((q->size == 0) & !q->closed)
+        pthread_cond_wait(&q->not_empty, &q->mutex);
+    if (q->size > 0) {
+        item = q->items[q->head];
+        q->head = (q->head + 1) % q->capacity;
+        q->size--;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->mutex);
+    return item;
+}
+
+/* No more items will be pushed: wake up every waiting consumer. */
+static void
+queueClose(BuildQueue *q)
+{
+    pthread_mutex_lock(&q->mutex);
+    q->closed = true;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+/* Records a failure of any stage. It is read by BddBuilder_Finish once
+all threads have been joined. */
+static void
+setFailed(BddBuilder *b)
+{
+    pthread_mutex_lock(&b->batches.mutex);
+    b->failed = true;
+    pthread_mutex_unlock(&b->batches.mutex);
+}
+
+static BuildBlock *
+newBlock(int nvars, int block_size)
+{
+    BuildBlock *block = ALLOC(BuildBlock, 1);
+    if (block == NULL)
+        return NULL;
+    block->n_models = 0;
+    block->models = ALLOC(int, (size_t) nvars * block_size);
+    if (block->models == NULL) {
+        FREE(block);
+        return NULL;
+    }
+    return block;
+}
+
+static void
+freeBlock(BuildBlock *block)
+{
+    FREE(block->models);
+    FREE(block);
+}
+
+static void
+freeBatch(BuildBatch *batch)
+{
+    if (batch->var != NULL) FREE(batch->var);
+    if (batch->child0 != NULL) FREE(batch->child0);
+    if (batch->child1 != NULL) FREE(batch->child1);
+    FREE(batch);
+}
+
+/* Builds the trie of <code> rows[lo..hi-1] </code> from variable
+<code> var </code> on, appending its nodes to <code> batch </code> in
+postorder. Partitioning the rows on each variable sorts them as a
+binary radix sort would, and duplicated models collapse into the same
+leaf. Returns the index of the root node, or a terminal. */
+static int
+buildTrie_Aux(BuildBatch *batch, int **rows, int lo, int hi, int var, int nvars)
+{
+    int i, j, k, E, T;
+    int *tmp;
+
+    if (lo == hi)
+        return BUILD_ZERO;
+    if (var == nvars)
+        return BUILD_ONE;
+
+    /* Rows with var false first, as buildExpression treats any non-zero
+    value as true. */
+    i = lo;
+    j = hi - 1;
+    while (i <= j) {
+        if (!rows[i][var])
+            i++;
+        else {
+            tmp = rows[i];
+            rows[i] = rows[j];
+            rows[j] = tmp;
+            j--;
+        }
+    }
+
+    E = buildTrie_Aux(batch, rows, lo, i, var + 1, nvars);
+    T = buildTrie_Aux(batch, rows, i, hi, var + 1, nvars);
+
+    k = batch->n_nodes++;
+    batch->var[k] = var;
+    batch->child0[k] = E;
+    batch->child1[k] = T;
+    return k;
+}
+
+static BuildBatch *
+buildTrie(BuildBlock *block, int nvars)
+{
+    BuildBatch *batch;
+    int **rows;
+    size_t max_nodes = (size_t) block->n_models * nvars;
+    int k;
+
+    batch = ALLOC(BuildBatch, 1);
+    if (batch == NULL)
+        return NULL;
+    batch->n_nodes = 0;
+    batch->var = ALLOC(int, max_nodes + 1);
+    batch->child0 = ALLOC(int, max_nodes + 1);
+    batch->child1 = ALLOC(int, max_nodes + 1);
+    rows = ALLOC(int *, block->n_models);
+    if ((batch->var == NULL) | (batch->child0 == NULL) | (batch->child1 == NULL) | (rows == NULL)) {
+        if (rows != NULL) FREE(rows);
+        freeBatch(batch);
+        return NULL;
+    }
+
+    for (k = 0; k < block->n_models; k++)
+        rows[k] = block->models + (size_t) k * nvars;
+    batch->root = buildTrie_Aux(batch, rows, 0, block->n_models, 0, nvars);
+
+    FREE(rows);
+    return batch;
+}
+
+static void *
+producerLoop(void *arg)
+{
+    BddBuilder *b = (BddBuilder *) arg;
+    BuildBlock *block;
+    BuildBatch *batch;
+
+    while ((block = (BuildBlock *) queuePop(&b->blocks)) != NULL) {
+        batch = buildTrie(block, b->nvars);
+        freeBlock(block);
+        if (batch == NULL)
+            setFailed(b);
+        else
+            queuePush(&b->batches, batch);
+    }
+    return NULL;
+}
+
+/* Resolves a child of a trie node to a BDD node. */
+static DdNode *
+trieChild(DdManager *dd, DdNode **built, int child)
+{
+    if (child == BUILD_ZERO)
+        return Cudd_ReadLogicZero(dd);
+    else if (child == BUILD_ONE)
+        return Cudd_ReadOne(dd);
+    return built[child];
+}
+
+/* Converts a trie into a referenced BDD, bottom-up. Every trie node has a
+single parent, so each child is dereferenced as soon as its parent is
+built. Returns NULL if CUDD ran out of memory. */
+static DdNode *
+batchToBdd(DdManager *dd, BuildBatch *batch, DdNode **built)
+{
+    DdNode *f, *T, *E;
+    int k;
+
+    for (k = 0; k < batch->n_nodes; k++) {
+        T = trieChild(dd, built, batch->child1[k]);
+        E = trieChild(dd, built, batch->child0[k]);
+        f = Cudd_bddIte(dd, Cudd_bddIthVar(dd, batch->var[k]), T, E);
+        if (f == NULL)
+            break;
+        Cudd_Ref(f);
+        if (batch->child1[k] >= 0) Cudd_RecursiveDeref(dd, T);
+        if (batch->child0[k] >= 0) Cudd_RecursiveDeref(dd, E);
+        built[k] = f;
+    }
+
+    /* On failure, release the nodes that are still waiting for a parent. */
+    if (k < batch->n_nodes) {
+        for (int j = 0; j < k; j++) {
+            if (batch->child1[j] >= 0) built[batch->child1[j]] = NULL;
+            if (batch->child0[j] >= 0) built[batch->child0[j]] = NULL;
+        }
+        for (int j = 0; j < k; j++)
+            if (built[j] != NULL) Cudd_RecursiveDeref(dd, built[j]);
+        return NULL;
+    }
+
+    f = trieChild(dd, built, batch->root);
+    if (batch->root < 0)
+        Cudd_Ref(f);
+    return f;
+}
+
+static void *
+consumerLoop(void *arg)
+{
+    BddBuilder *b = (BddBuilder *) arg;
+    DdManager *dd = b->dd;
+    BuildBatch *batch;
+    DdNode **built = NULL, **tmp_built, *f, *tmp;
+    int capacity = 0;
+    bool ok = true;
+
+    while ((batch = (BuildBatch *) queuePop(&b->batches)) != NULL) {
+        /* Keep draining after a failure so that producers never block. */
+        if (ok && (batch->n_nodes > capacity)) {
+            tmp_built = REALLOC(DdNode *, built, batch->n_nodes);
+            if (tmp_built == NULL)
+                ok = false;
+            else {
+                built = tmp_built;
+                capacity = batch->n_nodes;
+            }
+        }
+        if (ok) {
+            f = batchToBdd(dd, batch, built);
+            tmp = (f == NULL) ? NULL : Cudd_bddOr(dd, b->bdd, f);
+            if (tmp == NULL)
+                ok = false;
+            else {
+                Cudd_Ref(tmp);
+                Cudd_RecursiveDeref(dd, b->bdd);
+                b->bdd = tmp;
+            }
+            if (f != NULL)
+                Cudd_RecursiveDeref(dd, f);
+        }
+        freeBatch(batch);
+    }
+
+    if (built != NULL)
+        FREE(built);
+    if (!ok)
+        setFailed(b);
+    return NULL;
+}
+
+/**
+  @brief Starts a pipelined builder of the disjunction of the models
+  passed to BddBuilder_Add.
+
+  Models are gathered in blocks of <code> block_size </code>, each one
+  deduplicated into a trie by one of <code> n_producers </code> threads.
+  A consumer thread owns <code> dd </code> until BddBuilder_Finish
+  returns, so the caller must not use the manager in the meantime.
+
+  Returns NULL if <code> nvars </code> is negative,
+  <code> n_producers </code> or <code> block_size </code> is smaller than
+  1, memory could not be allocated or the threads could not be started.
+
+  @sideeffect Creates the variables 0..nvars-1 of <code> dd </code>.
+
+*/
+
+BddBuilder *
+BddBuilder_Init(
+    DdManager *dd,
+    int nvars,
+    int n_producers,
+    int block_size)
+{
+    BddBuilder *b;
+    int i, started;
+
+    /* Empty queues or blocks would deadlock the pipeline or overflow
+    the block buffer. */
+    if ((nvars < 0) | (n_producers < 1) | (block_size < 1))
+        return NULL;
+
+    /* Create the variables before the consumer starts, as
+    buildExpression would, so that their order is fixed by index. */
+    for (i = 0; i < nvars; i++)
+        if (Cudd_bddIthVar(dd, i) == NULL)
+            return NULL;
+
+    b = ALLOC(BddBuilder, 1);
+    if (b == NULL)
+        return NULL;
+    b->dd = dd;
+    b->nvars = nvars;
+    b->block_size = block_size;
+    b->n_producers = n_producers;
+    b->failed = false;
+
+    b->bdd = Cudd_ReadLogicZero(dd);
+    Cudd_Ref(b->bdd);
+
+    b->current = newBlock(nvars, block_size);
+    b->producers = ALLOC(pthread_t, n_producers);
+    if ((b->current == NULL) | (b->producers == NULL))
+        goto cleanup_builder;
+    if (!queueInit(&b->blocks, 2 * n_producers))
+        goto cleanup_builder;
+    if (!queueInit(&b->batches, 2 * n_producers)) {
+        queueDestroy(&b->blocks);
+        goto cleanup_builder;
+    }
+
+    if (pthread_create(&b->consumer, NULL, consumerLoop, b) != 0)
+        goto cleanup_queues;
+    for (started = 0; started < n_producers; started++)
+        if (pthread_create(&b->producers[started], NULL, producerLoop, b) != 0)
+            break;
+    if (started < n_producers) {
+        queueClose(&b->blocks);
+        for (i = 0; i < started; i++)
+            pthread_join(b->producers[i], NULL);
+        queueClose(&b->batches);
+        pthread_join(b->consumer, NULL);
+        goto cleanup_queues;
+    }
+    return b;
+
+cleanup_queues:
+    queueDestroy(&b->blocks);
+    queueDestroy(&b->batches);
+cleanup_builder:
+    Cudd_RecursiveDeref(dd, b->bdd);
+    if (b->current != NULL) freeBlock(b->current);
+    if (b->producers != NULL) FREE(b->producers);
+    FREE(b);
+    return NULL;
+}
+
+/**
+  @brief Adds a model, given as the values of the <code> nvars </code>
+  variables, to the disjunction.
+
+  Only copies the model; full blocks are handed to the producers.
+
+  Returns false if a new block could not be allocated.
+
+  @sideeffect None
+
+*/
+
+bool
+BddBuilder_Add(
+    BddBuilder *b,
+    int assignments[])
+{
+    BuildBlock *block = b->current;
+
+    /* A previous block could not be allocated. */
+    if (block == NULL)
+        return false;
+
+    memcpy(block->models + (size_t) block->n_models * b->nvars, assignments, b->nvars * sizeof(int));
+    block->n_models++;
+
+    if (block->n_models == b->block_size) {
+        queuePush(&b->blocks, block);
+        b->current = newBlock(b->nvars, b->block_size);
+        if (b->current == NULL)
+            return false;
+    }
+    return true;
+}
+
+/**
+  @brief Flushes the pending models, waits for the pipeline to drain and
+  releases the builder.
+
+  Returns the referenced %BDD of the disjunction of every model added,
+  or NULL if any stage ran out of memory.
+
+  @sideeffect None
+
+*/
+
+DdNode *
+BddBuilder_Finish(
+    BddBuilder *b)
+{
+    DdNode *bdd;
+    int i;
+
+    if (b->current != NULL) {
+        if (b->current->n_models > 0)
+            queuePush(&b->blocks, b->current);
+        else
+            freeBlock(b->current);
+    }
+    else
+        setFailed(b);
+
+    queueClose(&b->blocks);
+    for (i = 0; i < b->n_producers; i++)
+        pthread_join(b->producers[i], NULL);
+    queueClose(&b->batches);
+    pthread_join(b->consumer, NULL);
+
+    bdd = b->bdd;
+    if (b->failed) {
+        Cudd_RecursiveDeref(b->dd, bdd);
+        bdd = NULL;
+    }
+
+    queueDestroy(&b->blocks);
+    queueDestroy(&b->batches);
+    FREE(b->producers);
+    FREE(b);
+    return bdd;
+}
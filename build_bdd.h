@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+/*
+#include <cudd.h>
+#include <cudd/util.h>
+#include <cudd/st.h>
+*/
+
+#ifndef _BUILD_BDD   /* Include guard */
+#define _BUILD_BDD
+
+/* Bounded FIFO of pointers shared between pipeline stages. */
+typedef struct BuildQueue {
+    void **items;
+    int capacity;
+    int head;
+    int size;
+    bool closed;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} BuildQueue;
+
+/* Models received from the solver, one row of nvars ints each. */
+typedef struct BuildBlock {
+    int n_models;
+    int *models;
+} BuildBlock;
+
+/* Trie of the distinct models of a block, in postorder. Node k tests
+variable var[k]; child0/child1 index earlier nodes, or are
+BUILD_ZERO / BUILD_ONE for the terminals. */
+typedef struct BuildBatch {
+    int root;
+    int n_nodes;
+    int *var;
+    int *child0;
+    int *child1;
+} BuildBatch;
+
+#define BUILD_ZERO -1
+#define BUILD_ONE  -2
+
+/* Pipelined construction of the disjunction of a stream of models. */
+typedef struct BddBuilder {
+    DdManager *dd;        /* Only touched by the consumer thread. */
+    int nvars;
+    int block_size;
+    BuildBlock *current;  /* Block being filled by BddBuilder_Add. */
+    BuildQueue blocks;    /* Caller -> producers. */
+    BuildQueue batches;   /* Producers -> consumer. */
+    int n_producers;
+    pthread_t *producers;
+    pthread_t consumer;
+    DdNode *bdd;          /* Accumulated disjunction, referenced. */
+    bool failed;
+} BddBuilder;
+
+BddBuilder * BddBuilder_Init(DdManager *dd, int nvars, int n_producers, int block_size);
+
+bool BddBuilder_Add(BddBuilder *b, int assignments[]);
+
+DdNode * BddBuilder_Finish(BddBuilder *b);
+
+#endif
@@ -1,10 +1,14 @@
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
 /*
 #include <cudd.h>
 #include <cudd/util.h>
 #include <cudd/st.h>
 */
+#include "count_bdd.h"
 
 /* Computer the power of 2 based on the number of nodes marginalized between
 the parent and child node. If the child node is a terminal 1, we have a total
@@ -34,7 +38,7 @@ int getIndex(
     int nvars,
     DdNode *node) 
 {
-    if ((node == Cudd_ReadOne(dd)) |  (node == Cudd_ReadZero(dd)))
+    if (Cudd_IsConstant(node))
         return nvars;
     return Cudd_NodeReadIndex(node);
 }
@@ -399,6 +403,713 @@ SatCount_Cache_Aux(
 
 } /* end of SatCount_Cache_Aux */
 
+/* Advances the xorshift64* generator <code> state </code> and returns a
+uniform double in [0, 1). The state must be seeded with a non-zero value. */
+static inline double
+sampleUniform(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return ((x * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* log(2), as M_LN2 is not part of ISO C. */
+#define LOG_2 0.69314718055994530942
+
+/* Whether a constant reached by a traversal is a model: a complemented
+constant is the logical zero of a %BDD, and an %ADD leaf is accepting
+unless its value is zero. */
+static inline bool
+isAccepting(DdNode *node)
+{
+    return !Cudd_IsComplement(node) && (Cudd_V(node) != 0);
+}
+
+/* Log of the probability of taking branch <code> value </code> at variable
+<code> var </code>. Uniform sampling (<code> weights == NULL </code>) is
+the same as every variable being true with probability 0.5; otherwise
+<code> weights[var] </code> is that probability. */
+static inline double
+logBranch(double *weights, int var, int value)
+{
+    if (weights == NULL)
+        return -LOG_2;
+    return log(value ? weights[var] : 1.0 - weights[var]);
+}
+
+/* log(exp(a) + exp(b)), exact when either mass is zero (-inf). */
+static inline double
+logSum(double a, double b)
+{
+    if (a == -INFINITY)
+        return b;
+    if (b == -INFINITY)
+        return a;
+    if (a < b)
+        return b + log1p(exp(a - b));
+    return a + log1p(exp(b - a));
+}
+
+/* Entry of the table filled by SatSample_Mass_Aux for each internal node.
+<code> mass </code> is the log of the probability that a random assignment
+of the variables from the node's index to <code> nvars-1 </code> is a
+model agreeing with the evidence; masses are normalized and in log space,
+so they neither overflow nor underflow on programs with thousands of
+variables. <code> probT </code> is the probability of taking the Then
+branch when sampling. */
+typedef struct SampleNode {
+    double mass;
+    double probT;
+} SampleNode;
+
+/* Frees the values of a memoization table before it is released. */
+static enum st_retval
+freeEntry(void *key, void *value, void *arg)
+{
+    FREE(value);
+    return ST_CONTINUE;
+}
+
+/**
+  @brief Computes the log mass and the Then probability of every node
+  below <code> node </code>, storing them in <code> masses </code>.
+
+  The marginalized variables between a node and its child contribute
+  the log factor <code> log_gap[index_child] - log_gap[index_parent + 1]
+  </code>, where <code> log_gap </code> is the prefix sum built by
+  SatSample. If <code> countable </code> is not NULL, it holds the counts
+  filled by SatCount, and the mass of a node is its count divided by
+  <math> 2^{nvars - index} </math>.
+
+  Returns the log mass of <code> node </code>, or NAN if the table could
+  not be grown or a node is missing from <code> countable </code>.
+
+  @sideeffect None
+
+*/
+
+double
+SatSample_Mass_Aux(
+  DdManager *dd,
+  DdNode *node,
+  st_table *masses,
+  st_table *countable,
+  int nvars,
+  int *evidence,
+  double *weights,
+  double *log_gap
+  )
+{
+    DdNode *N, *T, *E;
+    double massT, massE;
+    SampleNode *entry;
+    int *count;
+    int index, indexT, indexE;
+
+    if (Cudd_IsConstant(node))
+        return isAccepting(node) ? 0.0 : -INFINITY;
+
+    if (st_lookup(masses, node, (void **) &entry))
+        return entry->mass;
+
+    N = Cudd_Regular(node);
+    index = Cudd_NodeReadIndex(N);
+
+    T = Cudd_T(N);
+    E = Cudd_E(N);
+    T = Cudd_NotCond(T, Cudd_IsComplement(node));
+    E = Cudd_NotCond(E, Cudd_IsComplement(node));
+
+    indexT = getIndex(dd, nvars, T);
+    indexE = getIndex(dd, nvars, E);
+
+    /* An observed variable prunes the branch that contradicts it. */
+    massT = -INFINITY;
+    if (evidence[index] != 0) {
+        massT = SatSample_Mass_Aux(dd, T, masses, countable, nvars, evidence, weights, log_gap);
+        if (isnan(massT)) return NAN;
+        massT += logBranch(weights, index, 1) + log_gap[indexT] - log_gap[index + 1];
+    }
+    massE = -INFINITY;
+    if (evidence[index] != 1) {
+        massE = SatSample_Mass_Aux(dd, E, masses, countable, nvars, evidence, weights, log_gap);
+        if (isnan(massE)) return NAN;
+        massE += logBranch(weights, index, 0) + log_gap[indexE] - log_gap[index + 1];
+    }
+
+    entry = ALLOC(SampleNode, 1);
+    if (entry == NULL)
+        return NAN;
+    if (countable == NULL)
+        entry->mass = logSum(massT, massE);
+    else if (st_lookup(countable, node, (void **) &count))
+        entry->mass = log((double) *count) - (nvars - index) * LOG_2;
+    else {
+        printf("st table lookup failed\n");
+        FREE(entry);
+        return NAN;
+    }
+    /* P(Then) = 1 / (1 + exp(massE - massT)). */
+    entry->probT = (massT == -INFINITY) ? 0.0 : 1.0 / (1.0 + exp(massE - massT));
+
+    if (st_insert(masses, node, entry) == ST_OUT_OF_MEM) {
+        FREE(entry);
+        return NAN;
+    }
+    return entry->mass;
+
+} /* end of SatSample_Mass_Aux */
+
+/* Fills the marginalized variables in [begin, end) of a sample: observed
+variables take their evidence value, the remaining ones are drawn uniformly
+or according to <code> weights </code>. */
+static inline void
+fillGap(int *sample, int begin, int end, int *evidence, double *weights, uint64_t *seed)
+{
+    for (int v = begin; v < end; v++) {
+        if (evidence[v] != -1)
+            sample[v] = evidence[v];
+        else if (weights == NULL)
+            sample[v] = sampleUniform(seed) < 0.5;
+        else
+            sample[v] = sampleUniform(seed) < weights[v];
+    }
+}
+
+/**
+  @brief Draws <code> n_samples </code> satisfying assignments of a %BDD
+  or 0-1 %ADD.
+
+  Starting from the root, each node chooses its Then or Else child with
+  probability proportional to the mass below that child, times the mass
+  of the variables marginalized between them. These probabilities are
+  computed once per call, so drawing a sample costs one table lookup and
+  one random number per node on its path, plus the variables skipped by
+  the %DD, which are filled at random: O(nvars) in total. Leaves follow
+  the same rule as SatIter: complemented and zero constants reject.
+
+  If <code> weights </code> is NULL, models are drawn uniformly; otherwise
+  each model is drawn proportionally to the product of
+  <code> weights[i] </code> (resp. <code> 1 - weights[i] </code>) over its
+  true (resp. false) variables.
+
+  As in SatCount_Cache, the <code> n_obs </code> variables in
+  <code> obs_index </code> are fixed to <code> assignments </code>. Without
+  evidence and weights, the node masses are read from the counts in
+  <code> countable </code> (filled by SatCount on a 0-1 %ADD); otherwise
+  they are computed by SatSample_Mass_Aux, and <code> countable </code>
+  may be NULL.
+
+  Sample <code> s </code> is written to
+  <code> samples[s*nvars .. s*nvars + nvars-1] </code>. The generator
+  state <code> seed </code> must be non-zero and is updated in place.
+
+  Returns false if <code> *seed </code> is zero, memory could not be
+  allocated or the %DD has no model agreeing with the evidence.
+
+  @sideeffect None
+
+*/
+
+bool
+SatSample(
+    DdManager *dd,
+    DdNode *node,
+    st_table *countable,
+    int nvars,
+    int n_obs,
+    int *obs_index,
+    int *assignments,
+    double *weights,
+    int n_samples,
+    int *samples,
+    uint64_t *seed
+    )
+{
+    DdNode *N, *child;
+    st_table *table;
+    SampleNode *entry;
+    int *evidence, *sample;
+    double *log_gap;
+    int v, index;
+    bool use_count = (n_obs == 0) && (weights == NULL);
+    bool ok = false;
+
+    /* xorshift64* is stuck at zero. */
+    if (*seed == 0)
+        return false;
+
+    evidence = ALLOC(int, nvars);
+    log_gap = ALLOC(double, nvars + 1);
+    if ((evidence == NULL) | (log_gap == NULL))
+        goto cleanup_arrays;
+
+    for (v = 0; v < nvars; v++)
+        evidence[v] = -1;
+    for (v = 0; v < n_obs; v++)
+        evidence[obs_index[v]] = assignments[v];
+
+    /* log_gap[k] is the log mass of the variables 0..k-1 when none of
+    them appears in the BDD: a free variable sums to 1, while an observed
+    variable contributes the probability of its assignment. Only
+    differences of log_gap are used, so it stays finite and exact up to
+    rounding however many variables there are. */
+    log_gap[0] = 0.0;
+    for (v = 0; v < nvars; v++) {
+        if (evidence[v] == -1)
+            log_gap[v + 1] = log_gap[v];
+        else {
+            /* Evidence of probability zero has no model to sample from. */
+            if (logBranch(weights, v, evidence[v]) == -INFINITY)
+                goto cleanup_arrays;
+            log_gap[v + 1] = log_gap[v] + logBranch(weights, v, evidence[v]);
+        }
+    }
+
+    table = st_init_table(st_ptrcmp, st_ptrhash);
+    if (table == NULL)
+        goto cleanup_arrays;
+    /* Also rejects a root without models (-inf) or a failure (NAN). */
+    if (!(SatSample_Mass_Aux(dd, node, table, use_count ? countable : NULL, nvars,
+                             evidence, weights, log_gap) > -INFINITY))
+        goto cleanup_table;
+
+    for (int s = 0; s < n_samples; s++) {
+        sample = samples + (size_t) s * nvars;
+        index = getIndex(dd, nvars, node);
+        fillGap(sample, 0, index, evidence, weights, seed);
+
+        /* Every node reached has a positive mass, so the walk ends on
+        an accepting leaf. */
+        child = node;
+        while (index < nvars) {
+            N = Cudd_Regular(child);
+            st_lookup(table, child, (void **) &entry);
+            if (sampleUniform(seed) < entry->probT) {
+                sample[index] = 1;
+                child = Cudd_NotCond(Cudd_T(N), Cudd_IsComplement(child));
+            }
+            else {
+                sample[index] = 0;
+                child = Cudd_NotCond(Cudd_E(N), Cudd_IsComplement(child));
+            }
+            v = getIndex(dd, nvars, child);
+            fillGap(sample, index + 1, v, evidence, weights, seed);
+            index = v;
+        }
+    }
+    ok = true;
+
+cleanup_table:
+    st_foreach(table, freeEntry, NULL);
+    st_free_table(table);
+cleanup_arrays:
+    if (evidence != NULL) FREE(evidence);
+    if (log_gap != NULL) FREE(log_gap);
+    return ok;
+}
+
+int ProjSatCount_Aux(DdManager *dd, DdNode *node, st_table *countable, int nvars, int *proj_before);
+
+/**
+  @brief Computes the projected model count of a 0-1 %ADD onto the
+  <code> n_proj </code> variables in <code> proj_index </code>.
+
+  The variables outside the projection are abstracted by summation in a
+  single Cudd_addExistAbstract call, which memoizes on the %DD nodes,
+  yielding an %ADD over the projection variables that maps each
+  projected assignment (e.g. a total choice) to its number of models.
+  <code> count </code> receives how many projected assignments have at
+  least one model. If <code> choice_counts </code> is not NULL, it
+  receives the referenced %ADD of per-assignment model counts, which the
+  caller must dereference; otherwise the %ADD is released.
+
+  Returns false if CUDD or the hash table ran out of memory.
+
+  @sideeffect None
+
+*/
+
+bool
+ProjSatCount(
+    DdManager *dd,
+    DdNode *node,
+    int nvars,
+    int n_proj,
+    int *proj_index,
+    int *count,
+    DdNode **choice_counts
+    )
+{
+    DdNode **vars, *cube, *counts;
+    st_table *countable;
+    int *proj_before;
+    bool *in_proj;
+    int i, n_abs, index;
+    bool ok = false;
+
+    vars = ALLOC(DdNode *, nvars);
+    proj_before = ALLOC(int, nvars + 1);
+    in_proj = ALLOC(bool, nvars);
+    if ((vars == NULL) | (proj_before == NULL) | (in_proj == NULL))
+        goto cleanup_arrays;
+
+    for (i = 0; i < nvars; i++)
+        in_proj[i] = false;
+    for (i = 0; i < n_proj; i++)
+        in_proj[proj_index[i]] = true;
+
+    /* proj_before[k] counts the projection variables with index < k. */
+    proj_before[0] = 0;
+    n_abs = 0;
+    for (i = 0; i < nvars; i++) {
+        proj_before[i + 1] = proj_before[i] + (int) in_proj[i];
+        if (in_proj[i])
+            continue;
+        /* Reference each variable as soon as it is created: creating the
+        next one may trigger garbage collection or reordering. */
+        vars[n_abs] = Cudd_addIthVar(dd, i);
+        if (vars[n_abs] == NULL)
+            break;
+        Cudd_Ref(vars[n_abs]);
+        n_abs++;
+    }
+    if (i < nvars) {
+        for (i = 0; i < n_abs; i++)
+            Cudd_RecursiveDeref(dd, vars[i]);
+        goto cleanup_arrays;
+    }
+
+    cube = Cudd_addComputeCube(dd, vars, NULL, n_abs);
+    for (i = 0; i < n_abs; i++)
+        Cudd_RecursiveDeref(dd, vars[i]);
+    if (cube == NULL)
+        goto cleanup_arrays;
+    Cudd_Ref(cube);
+
+    counts = Cudd_addExistAbstract(dd, node, cube);
+    if (counts == NULL) {
+        Cudd_RecursiveDeref(dd, cube);
+        goto cleanup_arrays;
+    }
+    Cudd_Ref(counts);
+    Cudd_RecursiveDeref(dd, cube);
+
+    countable = st_init_table(st_ptrcmp, st_ptrhash);
+    if (countable != NULL) {
+        *count = ProjSatCount_Aux(dd, counts, countable, nvars, proj_before);
+        st_foreach(countable, freeEntry, NULL);
+        st_free_table(countable);
+
+        /* Marginalize the projection variables above the root. */
+        if (*count != -1) {
+            index = Cudd_IsConstant(counts) ? nvars : (int) Cudd_NodeReadIndex(counts);
+            *count = *count * ipow(2, proj_before[index]);
+            ok = true;
+        }
+    }
+
+    if (ok && choice_counts != NULL)
+        *choice_counts = counts;
+    else
+        Cudd_RecursiveDeref(dd, counts);
+
+cleanup_arrays:
+    if (vars != NULL) FREE(vars);
+    if (proj_before != NULL) FREE(proj_before);
+    if (in_proj != NULL) FREE(in_proj);
+    return ok;
+}
+
+/* Counts the assignments to the projection variables with index at
+least that of <code> node </code> that reach a non-zero terminal of the
+count %ADD. Only projection variables remain in the %ADD, so the gap
+between a node and its child marginalizes
+<code> proj_before[index_child] - proj_before[index + 1] </code> of them. */
+int
+ProjSatCount_Aux(
+  DdManager *dd,
+  DdNode *node,
+  st_table *countable,
+  int nvars,
+  int *proj_before
+  )
+{
+    DdNode *T, *E;
+    int count, countT, countE, index, indexT, indexE;
+    int *dummy;
+
+    if (Cudd_IsConstant(node))
+        return Cudd_V(node) != 0;
+
+    if (st_lookup(countable, node, (void **) &dummy))
+        return *dummy;
+
+    index = Cudd_NodeReadIndex(node);
+    T = Cudd_T(node);
+    E = Cudd_E(node);
+    indexT = Cudd_IsConstant(T) ? nvars : (int) Cudd_NodeReadIndex(T);
+    indexE = Cudd_IsConstant(E) ? nvars : (int) Cudd_NodeReadIndex(E);
+
+    countT = ProjSatCount_Aux(dd, T, countable, nvars, proj_before);
+    if (countT == -1) return -1;
+    countE = ProjSatCount_Aux(dd, E, countable, nvars, proj_before);
+    if (countE == -1) return -1;
+
+    count = countT * ipow(2, proj_before[indexT] - proj_before[index + 1]) +
+            countE * ipow(2, proj_before[indexE] - proj_before[index + 1]);
+
+    dummy = ALLOC(int, 1);
+    if (dummy == NULL)
+        return -1;
+    *dummy = count;
+    if (st_insert(countable, node, dummy) == ST_OUT_OF_MEM) {
+        FREE(dummy);
+        return -1;
+    }
+    return count;
+
+} /* end of ProjSatCount_Aux */
+
+void SatIter_Quit(SatIter *it);
+
+/**
+  @brief Initializes an iterator over the satisfying assignments of
+  <code> node </code>.
+
+  The <code> n_obs </code> variables in <code> obs_index </code> are fixed
+  to <code> assignments </code>, as in SatCount_Cache; paths contradicting
+  them are pruned. All the memory used by the iterator (the explicit %DFS
+  stack and the current model) is allocated here, once, so enumeration
+  itself never allocates.
+
+  <code> node </code> may be a %BDD or an %ADD: every constant other than
+  the logical and arithmetic zeros is accepting. A 0-1 %ADD thus yields
+  its models, and the count %ADD of ProjSatCount the projected
+  assignments having at least one model.
+
+  Returns false if memory could not be allocated.
+
+  @sideeffect None
+
+  @see SatIter_NextCube SatIter_Next SatIter_Quit
+
+*/
+
+bool
+SatIter_Init(
+    SatIter *it,
+    DdManager *dd,
+    DdNode *node,
+    int nvars,
+    int n_obs,
+    int *obs_index,
+    int *assignments
+    )
+{
+    int v;
+
+    it->dd = dd;
+    it->nvars = nvars;
+    it->depth = 0;
+    it->n_free = 0;
+    it->pending = false;
+
+    /* A path visits at most nvars internal nodes plus one terminal. */
+    it->stack_node = ALLOC(DdNode *, nvars + 1);
+    it->stack_branch = ALLOC(int, nvars + 1);
+    it->base = ALLOC(int, nvars);
+    it->current = ALLOC(int, nvars);
+    it->model = ALLOC(int, nvars);
+    it->free_vars = ALLOC(int, nvars);
+    if ((it->stack_node == NULL) | (it->stack_branch == NULL) | (it->base == NULL) |
+        (it->current == NULL) | (it->model == NULL) | (it->free_vars == NULL)) {
+        SatIter_Quit(it);
+        return false;
+    }
+
+    /* base[v] is the value of v in a cube before any node fixes it:
+    its observation if v is observed, and 2 (don't care) otherwise. */
+    for (v = 0; v < nvars; v++)
+        it->base[v] = 2;
+    for (v = 0; v < n_obs; v++)
+        it->base[obs_index[v]] = assignments[v];
+    memcpy(it->current, it->base, nvars * sizeof(int));
+
+    it->stack_node[0] = node;
+    it->stack_branch[0] = 1;
+    return true;
+}
+
+/**
+  @brief Writes the next satisfying cube into <code> cube </code>.
+
+  Each cube corresponds to one path from the root to the terminal 1:
+  <code> cube[v] </code> is 1 or 0 if v is fixed by the path or by the
+  evidence, and 2 if v is marginalized. Cubes are disjoint, so their
+  expansions enumerate every model exactly once.
+
+  Returns false once all cubes have been produced.
+
+  @sideeffect None
+
+*/
+
+bool
+SatIter_NextCube(
+    SatIter *it,
+    int *cube
+    )
+{
+    DdNode *node, *N, *child;
+    int index, branch;
+
+    while (it->depth >= 0) {
+        node = it->stack_node[it->depth];
+
+        if (Cudd_IsConstant(node)) {
+            /* Pop the terminal: the parent resumes on its next branch
+            the next time we are called. */
+            it->depth--;
+            if (!isAccepting(node))
+                continue;
+            memcpy(cube, it->current, it->nvars * sizeof(int));
+            return true;
+        }
+
+        N = Cudd_Regular(node);
+        index = Cudd_NodeReadIndex(N);
+        branch = it->stack_branch[it->depth];
+
+        /* Both branches were explored: restore the variable and pop. */
+        if (branch < 0) {
+            it->current[index] = it->base[index];
+            it->depth--;
+            continue;
+        }
+        it->stack_branch[it->depth] = branch - 1;
+
+        /* The branch contradicts the evidence on this variable. */
+        if ((it->base[index] != 2) & (it->base[index] != branch))
+            continue;
+
+        it->current[index] = branch;
+        child = branch ? Cudd_T(N) : Cudd_E(N);
+        child = Cudd_NotCond(child, Cudd_IsComplement(node));
+
+        it->depth++;
+        it->stack_node[it->depth] = child;
+        it->stack_branch[it->depth] = 1;
+    }
+    return false;
+}
+
+/**
+  @brief Writes the next satisfying assignment of all <code> nvars </code>
+  variables into <code> assignment </code>.
+
+  Expands the don't cares of each cube from SatIter_NextCube with a
+  binary counter. Calls to SatIter_Next and SatIter_NextCube should not
+  be mixed on the same iterator.
+
+  Returns false once all models have been produced.
+
+  @sideeffect None
+
+*/
+
+bool
+SatIter_Next(
+    SatIter *it,
+    int *assignment
+    )
+{
+    int j, v;
+
+    if (it->pending) {
+        /* Increment the binary counter over the free variables. */
+        for (j = 0; j < it->n_free; j++) {
+            v = it->free_vars[j];
+            if (it->model[v] == 0) {
+                it->model[v] = 1;
+                break;
+            }
+            it->model[v] = 0;
+        }
+        if (j < it->n_free) {
+            memcpy(assignment, it->model, it->nvars * sizeof(int));
+            return true;
+        }
+        it->pending = false;
+    }
+
+    if (!SatIter_NextCube(it, assignment))
+        return false;
+
+    /* Start the counter of the new cube at all free variables false. */
+    it->n_free = 0;
+    for (v = 0; v < it->nvars; v++) {
+        if (assignment[v] == 2) {
+            it->free_vars[it->n_free++] = v;
+            assignment[v] = 0;
+        }
+    }
+    memcpy(it->model, assignment, it->nvars * sizeof(int));
+    it->pending = true;
+    return true;
+}
+
+/**
+  @brief Writes up to <code> n </code> satisfying assignments into
+  <code> buffer </code>, assignment <code> k </code> occupying
+  <code> buffer[k*nvars .. k*nvars + nvars-1] </code>.
+
+  Returns the number of assignments written, which is smaller than
+  <code> n </code> only when the enumeration is over.
+
+  @sideeffect None
+
+*/
+
+int
+SatIter_Fill(
+    SatIter *it,
+    int *buffer,
+    int n
+    )
+{
+    int k;
+
+    for (k = 0; k < n; k++) {
+        if (!SatIter_Next(it, buffer + (size_t) k * it->nvars))
+            break;
+    }
+    return k;
+}
+
+/**
+  @brief Releases the memory held by an iterator.
+
+  @sideeffect None
+
+*/
+
+void
+SatIter_Quit(
+    SatIter *it
+    )
+{
+    if (it->stack_node != NULL) FREE(it->stack_node);
+    if (it->stack_branch != NULL) FREE(it->stack_branch);
+    if (it->base != NULL) FREE(it->base);
+    if (it->current != NULL) FREE(it->current);
+    if (it->model != NULL) FREE(it->model);
+    if (it->free_vars != NULL) FREE(it->free_vars);
+}
+
 DdNode *
 buildExpression(
     DdManager *dd, 
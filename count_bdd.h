@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 /*
 #include <cudd.h>
 #include <cudd/util.h>
@@ -9,6 +10,22 @@
 #ifndef _COUNT_BDD   /* Include guard */
 #define _COUNT_BDD
 
+/* State of an enumeration of the satisfying assignments of a BDD.
+All arrays are allocated by SatIter_Init and released by SatIter_Quit. */
+typedef struct SatIter {
+    DdManager *dd;
+    int nvars;
+    DdNode **stack_node;  /* DFS stack of the nodes on the current path. */
+    int *stack_branch;    /* Next branch to explore at each node (1, 0, then -1). */
+    int depth;
+    int *base;            /* Evidence value of each variable, or 2 if unobserved. */
+    int *current;         /* Cube of the current path. */
+    int *model;           /* Current expansion of the cube into a full assignment. */
+    int *free_vars;       /* Don't-care variables of the current cube. */
+    int n_free;
+    bool pending;         /* Whether model still has expansions left. */
+} SatIter;
+
 int ipow(int base, int exp);
 
 int getPower_Cache(DdManager *dd, DdNode *node, int index_child, int index_parent, int obs_child, int obs_parent, bool inside_parent);
@@ -23,6 +40,24 @@ bool SatCount_Cache(DdManager *dd, DdNode *node, st_table *countable, int nvars,
 
 int SatCount_Cache_Aux(DdManager *dd, DdNode *node, st_table *countable, int nvars, int index, int n_obs, int obs_pos, bool inside, int obs_index[], int assignments[]);
 
+double SatSample_Mass_Aux(DdManager *dd, DdNode *node, st_table *masses, st_table *countable, int nvars, int *evidence, double *weights, double *log_gap);
+
+bool SatSample(DdManager *dd, DdNode *node, st_table *countable, int nvars, int n_obs, int *obs_index, int *assignments, double *weights, int n_samples, int *samples, uint64_t *seed);
+
+bool ProjSatCount(DdManager *dd, DdNode *node, int nvars, int n_proj, int *proj_index, int *count, DdNode **choice_counts);
+
+int ProjSatCount_Aux(DdManager *dd, DdNode *node, st_table *countable, int nvars, int *proj_before);
+
+bool SatIter_Init(SatIter *it, DdManager *dd, DdNode *node, int nvars, int n_obs, int *obs_index, int *assignments);
+
+bool SatIter_NextCube(SatIter *it, int *cube);
+
+bool SatIter_Next(SatIter *it, int *assignment);
+
+int SatIter_Fill(SatIter *it, int *buffer, int n);
+
+void SatIter_Quit(SatIter *it);
+
 DdNode * buildExpression(DdManager *dd, int nvars, int assigments[]);
 
 #endif
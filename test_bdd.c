@@ -6,12 +6,14 @@
 #include <math.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 /*
 #include <cudd.h>
 #include <cudd/util.h>
 #include <cudd/st.h>
 */
 #include "count_bdd.h"
+#include "build_bdd.h"
 
 /**
  * Print a dd summary
@@ -55,6 +57,26 @@ void minterm_print (DdManager *gbm, DdNode *dd, int nvars, char* fp)
     FILE *outfile; // output file pointer for .dot file
     outfile = fopen(fp,"w");
     Cudd_ApaPrintMinterm(outfile, gbm, dd, nvars);
+    fclose(outfile);
+}
+
+/**
+ * Counts the samples that are not models of the 0-1 ADD or that
+ * contradict the evidence
+ * @param the node object and the samples, nvars ints each
+ */
+int invalid_samples (DdManager *gbm, DdNode *dd, int nvars, int n_samples, int *samples,
+                     int n_obs, int *obs_index, int *assignments)
+{
+    int invalid = 0;
+    for (int s = 0; s < n_samples; s++) {
+        int *sample = samples + s*nvars;
+        bool ok = (Cudd_Eval(gbm, dd, sample) == Cudd_ReadOne(gbm));
+        for (int i = 0; i < n_obs; i++)
+            ok = ok && (sample[obs_index[i]] == assignments[i]);
+        invalid += !ok;
+    }
+    return invalid;
 }
 
 // This program creates a single BDD variable
@@ -170,18 +192,119 @@ int test1()
 
     printf("Contagem  (com cache) de mundos: %d\n", count_cache);
 
-    
+    int n_samples = 1000;
+    int samples[1000*5];
+    double weights[5] = {0.9, 0.1, 0.5, 0.3, 0.7};
+    uint64_t seed = 42;
+
+    /* No evidence: reads the counts stored in countable by SatCount. */
+    SatSample(dd, bdd, countable, nvars, 0, NULL, NULL, NULL, n_samples, samples, &seed);
+    printf("Amostras invalidas (uniforme): %d\n",
+           invalid_samples(dd, bdd, nvars, n_samples, samples, 0, NULL, NULL));
+
+    SatSample(dd, bdd, countable, nvars, 2, obs_index, assignemnt, NULL, n_samples, samples, &seed);
+    printf("Amostras invalidas (~0, 2): %d\n",
+           invalid_samples(dd, bdd, nvars, n_samples, samples, 2, obs_index, assignemnt));
+
+    SatSample(dd, bdd, NULL, nvars, 0, NULL, NULL, weights, n_samples, samples, &seed);
+    printf("Amostras invalidas (pesos): %d\n",
+           invalid_samples(dd, bdd, nvars, n_samples, samples, 0, NULL, NULL));
+
+    SatSample(dd, bdd, NULL, nvars, 2, obs_index, assignemnt, weights, n_samples, samples, &seed);
+    printf("Amostras invalidas (pesos, ~0, 2): %d\n",
+           invalid_samples(dd, bdd, nvars, n_samples, samples, 2, obs_index, assignemnt));
+
+    SatIter it;
+    int model[5], n_iter = 0, n_iter_obs = 0;
+
+    SatIter_Init(&it, dd, bdd, nvars, 0, NULL, NULL);
+    while (SatIter_Next(&it, model))
+        n_iter++;
+    SatIter_Quit(&it);
+
+    printf("Mundos enumerados: %d (SatCount: %d) %s\n", n_iter, count,
+           (n_iter == count) ? "ok" : "ERRO");
+
+    SatIter_Init(&it, dd, bdd, nvars, 2, obs_index, assignemnt);
+    while (SatIter_Next(&it, model))
+        n_iter_obs++;
+    SatIter_Quit(&it);
+
+    printf("Mundos enumerados (~0, 2): %d (SatCount_Cache: %d) %s\n", n_iter_obs, count_cache,
+           (n_iter_obs == count_cache) ? "ok" : "ERRO");
+
+    int count_proj;
+    int proj_index[2] = {0, 1};
+    DdNode *choice_counts;
+
+    if (ProjSatCount(dd, bdd, nvars, 2, proj_index, &count_proj, &choice_counts)) {
+        printf("Escolhas totais (0, 1) com modelos: %d\n", count_proj);
+        print_dd(dd, choice_counts, 2, 4);
+        Cudd_RecursiveDeref(dd, choice_counts);
+    }
+    else
+        printf("Contagem projetada falhou\n");
+
     Cudd_Quit(dd);
 
     return 0; 
 }
 
 
+int test2()
+{
+    DdManager *dd;
+    DdNode *bdd, *aux, *tmp, *piped;
+    BddBuilder *builder;
+
+    dd = Cudd_Init(0,0,CUDD_UNIQUE_SLOTS,CUDD_CACHE_SLOTS,0);
+
+    int n_models = 6; /* Repeated models must be merged only once. */
+    int nvars = 4;
+    int var_assigments[6][4] = {
+                                    {0, 0, 1, 1},
+                                    {0, 1, 0, 1},
+                                    {1, 1, 1, 0},
+                                    {0, 0, 1, 1},
+                                    {1, 0, 0, 0},
+                                    {0, 1, 0, 1}
+    };
+
+    /* Serial construction, as in test1. */
+    bdd = Cudd_ReadLogicZero(dd);
+    Cudd_Ref(bdd);
+    for(int i = 0; i < n_models; i++) {
+        tmp = buildExpression(dd, nvars, var_assigments[i]);
+        aux = Cudd_bddOr(dd, bdd, tmp);
+        Cudd_Ref(aux);
+        Cudd_RecursiveDeref(dd, tmp);
+        Cudd_RecursiveDeref(dd, bdd);
+        bdd = aux;
+    }
+
+    /* Pipelined construction, with blocks smaller than the model list. */
+    builder = BddBuilder_Init(dd, nvars, 2, 4);
+    for(int i = 0; i < n_models; i++)
+        BddBuilder_Add(builder, var_assigments[i]);
+    piped = BddBuilder_Finish(builder);
+
+    printf("BDD em pipeline igual ao serial: %s\n", (piped == bdd) ? "sim" : "nao");
+
+    Cudd_RecursiveDeref(dd, piped);
+    Cudd_RecursiveDeref(dd, bdd);
+    Cudd_Quit(dd);
+
+    return 0;
+}
+
+
 int main(int argc, char *argv[])
 {   
     printf("Test 0:\n");
     test0();
     printf("Test 1:\n");
     test1();
+    printf("Test 2:\n");
+    test2();
     return 0;
 }